@@ -3,6 +3,7 @@
 #include "Message.hpp"
 #include "ThreadSafeQueue.hpp"
 #include "Connection.hpp"
+#include "TimerWheel.hpp"
 
 namespace sockets
 {
@@ -11,7 +12,11 @@ namespace sockets
 	{
 	public:
 		ClientInterface() = default;
+		explicit ClientInterface(ConnectionSettings settings);
 
+		// With Dispatch::Inline the I/O thread calls OnMessage until Disconnect
+		// returns, so a derived class overriding it has to call Disconnect from
+		// its own destructor.
 		virtual ~ClientInterface();
 
 		ClientInterface(ClientInterface&) = delete;
@@ -22,6 +27,17 @@ namespace sockets
 		bool Connect(const std::string& host, uint16_t port);
 
 		void Send(const message<Data>& msg);
+		void Send(const message<Data>& msg, Priority priority);
+
+		void SendStream(Data id, typename Connection<Data>::ChunkProducer producer, Priority priority = Priority::Low);
+
+		// Ids without a priority go out on Priority::Normal. The map is read on
+		// the I/O thread in inline mode and is not locked; must be set before Connect.
+		void SetPriority(Data id, Priority priority);
+		Priority PriorityOf(Data id) const;
+
+		// Bodies with this id bypass reassembly and Incoming(); must be set before Connect.
+		void SetStreamHandler(Data id, typename Connection<Data>::ChunkHandler handler);
 
 		void Disconnect();
 
@@ -29,15 +45,34 @@ namespace sockets
 
 		ThreadSafeQueue<owned_message<Data>>& Incoming();
 
+		// Only called with Dispatch::Inline, on the I/O thread. Queued clients read Incoming() instead.
+		virtual void OnMessage(message<Data>& msg) {}
+
 	protected:
+		void DispatchInline(owned_message<Data>&& message);
+
+		ConnectionSettings m_settings;
+		std::map<Data, Priority> m_priorities;
+		std::shared_ptr<typename Connection<Data>::ChunkHandlers> m_streamHandlers = std::make_shared<typename Connection<Data>::ChunkHandlers>();
+
 		asio::io_context m_asioContext;
+		std::unique_ptr<ConnectionTimers<Data>> m_timers;
+#ifdef SOCKETS_IO_URING
+		std::shared_ptr<RegisteredHeaders<Data>> m_registeredHeaders;
+#endif
 		std::jthread m_threadContext;
-		std::unique_ptr<Connection<Data>> m_connection;
+		std::shared_ptr<Connection<Data>> m_connection;
 	private:
 		ThreadSafeQueue<owned_message<Data>> m_messagesIn;
 	};
 
 	
+	template <typename Data>
+	ClientInterface<Data>::ClientInterface(ConnectionSettings settings):
+		m_settings(settings)
+	{
+	}
+
 	template <typename Data>
 	ClientInterface<Data>::~ClientInterface()
 	{
@@ -52,13 +87,35 @@ namespace sockets
 			asio::ip::tcp::resolver resolver(m_asioContext);
 			auto endPoints = resolver.resolve(host, std::to_string(port));
 
-			m_connection = std::make_unique<Connection<Data>>(
+			m_connection = std::make_shared<Connection<Data>>(
 				Connection<Data>::Owner::Client,
 				m_asioContext,
 				asio::ip::tcp::socket(m_asioContext),
-				m_messagesIn
+				m_messagesIn,
+				m_settings
 			);
 
+			m_connection->SetStreamHandlers(m_streamHandlers);
+#ifdef SOCKETS_IO_URING
+			if (!m_registeredHeaders)
+				m_registeredHeaders = std::make_shared<RegisteredHeaders<Data>>(m_asioContext, 1);
+			m_connection->SetRegisteredHeaders(m_registeredHeaders);
+#endif
+			if (m_settings.dispatch == ConnectionSettings::Dispatch::Inline)
+			{
+				m_connection->SetMessageHandler([this](owned_message<Data>&& message)
+				{
+					DispatchInline(std::move(message));
+				});
+			}
+			// The server side owns reaping; a timed out client is simply closed.
+			if (m_settings.UsesTimers())
+			{
+				if (!m_timers)
+					m_timers = std::make_unique<ConnectionTimers<Data>>(m_asioContext, m_settings.timerTick, nullptr);
+				m_timers->Watch(m_connection);
+			}
+
 			m_connection->ConnectToServer(endPoints);
 
 			m_threadContext = std::jthread([this]()
@@ -77,10 +134,72 @@ namespace sockets
 	template <typename Data>
 	void ClientInterface<Data>::Send(const message<Data>& msg)
 	{
-		if (IsConnected())
+		Send(msg, PriorityOf(msg.header.id));
+	}
+
+	template <typename Data>
+	void ClientInterface<Data>::Send(const message<Data>& msg, Priority priority)
+	{
+		// Messages sent before validation are queued, up to maxEarlyMessages, and
+		// written right behind the validation reply.
+		if (m_connection)
+		{
+			m_connection->Send(msg, priority);
+		}
+	}
+
+	template <typename Data>
+	void ClientInterface<Data>::SendStream(Data id, typename Connection<Data>::ChunkProducer producer, Priority priority)
+	{
+		if (m_connection)
+		{
+			m_connection->SendStream(id, std::move(producer), priority);
+		}
+	}
+
+	template <typename Data>
+	void ClientInterface<Data>::SetPriority(Data id, Priority priority)
+	{
+		m_priorities[id] = priority;
+	}
+
+	template <typename Data>
+	Priority ClientInterface<Data>::PriorityOf(Data id) const
+	{
+		const auto it = m_priorities.find(id);
+		return it != m_priorities.end() ? it->second : Priority::Normal;
+	}
+
+	template <typename Data>
+	void ClientInterface<Data>::SetStreamHandler(Data id, typename Connection<Data>::ChunkHandler handler)
+	{
+		(*m_streamHandlers)[id] = std::move(handler);
+	}
+
+	template <typename Data>
+	void ClientInterface<Data>::DispatchInline(owned_message<Data>&& message)
+	{
+#ifndef NDEBUG
+		const auto start = std::chrono::steady_clock::now();
+#endif
+#ifdef SOCKETS_TRACING
+		message.trace.dequeued = TraceNow();
+#endif
+		OnMessage(message.msg);
+#ifdef SOCKETS_TRACING
+		if (message.trace.read != 0)
+		{
+			message.trace.handled = TraceNow();
+			Tracer().Record(message.trace);
+		}
+#endif
+#ifndef NDEBUG
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+		if (elapsed > m_settings.inlineHandlerBudget)
 		{
-			m_connection->Send(msg);
+			std::cout << "[CLIENT] OnMessage blocked the I/O thread for " << elapsed.count() << "us" << std::endl;
 		}
+#endif
 	}
 
 	template <typename Data>
@@ -98,7 +217,7 @@ namespace sockets
 			m_threadContext.join();
 		}
 
-		m_connection.release();
+		m_connection.reset();
 	}
 
 	template <typename Data>
@@ -1,6 +1,13 @@
 #pragma once
 
 #include <memory>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <map>
+#include <optional>
+#include <span>
+#include <string_view>
 #include <thread>
 #include <mutex>
 #include <deque>
@@ -3,12 +3,85 @@
 #include "CommonIncludes.h"
 #include "ThreadSafeQueue.hpp"
 #include "Message.hpp"
+#include "IoUring.hpp"
 
 namespace sockets
 {
 	template <typename Data>
 	class ServerInterface;
 
+	// Exchanged after the validation value so both ends know which optional
+	// frame extensions the other one understands.
+	// CapabilityTrace: this end records a span for every traced frame it receives.
+	inline constexpr uint8_t CapabilityTrace = 0x01;
+
+	struct ConnectionSettings
+	{
+		// Bodies larger than this are split into fragments so that frames from
+		// higher priority lanes can be written in between. Zero disables splitting.
+		uint32_t maxChunkSize = 64 * 1024;
+
+		// Frames announcing a larger body are rejected before anything is allocated.
+		uint32_t maxFrameSize = 16 * 1024 * 1024;
+
+		// Upper bound for a body reassembled from fragments. Streamed ids are not
+		// reassembled and are only limited by maxFrameSize.
+		size_t maxMessageSize = 128 * 1024 * 1024;
+
+		// Inline runs OnMessage straight from the read completion on the I/O
+		// thread and leaves Update with nothing to do. Handlers must not block:
+		// every other connection on the context waits for them.
+		enum class Dispatch : uint8_t
+		{
+			Queued,
+			Inline
+		};
+
+		Dispatch dispatch = Dispatch::Queued;
+
+		// Debug builds report inline handlers that run longer than this.
+		std::chrono::microseconds inlineHandlerBudget{ 1000 };
+
+		// With SOCKETS_TRACING defined, one in this many sent messages carries
+		// trace stamps, provided the peer records spans. Zero turns sampling off.
+		// Queued clients hand messages out through Incoming() and never see them
+		// handled, so they record nothing and servers do not stamp frames for
+		// them; only inline clients trace the server to client direction.
+		uint32_t traceSampleEvery = 64;
+
+		// Header slots registered with the ring of a server's io_context, at
+		// most MaxRegisteredBuffers. Connections beyond it read headers through
+		// plain buffers. Only used by SOCKETS_IO_URING builds.
+		size_t registeredHeaderSlots = 4096;
+
+		// A heartbeat frame goes out whenever nothing else was sent for this
+		// long. Keep it well below the peer's idleTimeout. Zero disables it.
+		std::chrono::milliseconds heartbeatInterval{ 0 };
+
+		// Connections that receive nothing, heartbeats included, for this long
+		// are closed and reported through OnClientDisconnect. Zero disables it.
+		std::chrono::milliseconds idleTimeout{ 0 };
+
+		// Connections that have not validated within this long are closed.
+		// Zero disables it.
+		std::chrono::milliseconds handshakeTimeout{ 0 };
+
+		// Messages a client may queue before the server's challenge arrives;
+		// they go out right behind the validation reply. Further ones are
+		// dropped, so a server that never answers cannot grow the queue.
+		size_t maxEarlyMessages = 1024;
+
+		// Resolution of the timer wheel that drives the three timeouts above.
+		// With any of them set, connections closed by a read or write error are
+		// also removed and reported right away instead of on the next send.
+		std::chrono::milliseconds timerTick{ 10 };
+
+		bool UsesTimers() const
+		{
+			return heartbeatInterval.count() > 0 || idleTimeout.count() > 0 || handshakeTimeout.count() > 0;
+		}
+	};
+
 	template <typename Data>
 	class Connection : public std::enable_shared_from_this<Connection<Data>>
 	{
@@ -19,10 +92,27 @@ namespace sockets
 			Client
 		};
 
+		// Fills chunk with the next piece of a streamed body, returns false once
+		// that piece is the last one. Pieces larger than maxChunkSize go out as
+		// several frames. Called on the I/O thread.
+		using ChunkProducer = std::function<bool(std::vector<uint8_t>& chunk)>;
 
-		Connection(Owner owner, asio::io_context& asioContext, asio::ip::tcp::socket socket, ThreadSafeQueue<sockets::owned_message<Data>>& messageQueue);
+		// Receives a streamed body frame by frame on the I/O thread. remote is
+		// nullptr on the client side, like owned_message::remote.
+		using ChunkHandler = std::function<void(std::shared_ptr<Connection<Data>> remote, const message_header<Data>& header,
+			std::span<const uint8_t> chunk, bool last)>;
 
-		virtual ~Connection() = default;
+		// Replaces the incoming queue for inline dispatch. Called on the I/O thread.
+		using MessageHandler = std::function<void(owned_message<Data>&& msg)>;
+
+		// Told when a read or write error, or a protocol violation, closes the
+		// connection. Called once, on the I/O thread.
+		using CloseHandler = std::function<void(std::shared_ptr<Connection<Data>> connection)>;
+
+		Connection(Owner owner, asio::io_context& asioContext, asio::ip::tcp::socket socket, ThreadSafeQueue<sockets::owned_message<Data>>& messageQueue,
+			ConnectionSettings settings = {});
+
+		virtual ~Connection();
 
 		Connection(Connection&) = delete;
 		Connection& operator=(Connection&) = delete;
@@ -35,7 +125,26 @@ namespace sockets
 
 		bool IsConnected() const;
 
-		void Send(const message<Data>& msg);
+		void Send(const message<Data>& msg, Priority priority = Priority::Normal);
+		void SendStream(Data id, ChunkProducer producer, Priority priority = Priority::Low);
+
+		using ChunkHandlers = std::map<Data, ChunkHandler>;
+
+		void SetStreamHandlers(std::shared_ptr<const ChunkHandlers> handlers);
+		void SetMessageHandler(MessageHandler handler);
+		void SetCloseHandler(CloseHandler handler);
+
+		// Sends a heartbeat or closes the connection when one of its deadlines
+		// has passed. Returns when it wants to be checked next, time_point::max()
+		// once no deadline applies any more, or nothing once the connection is
+		// closed. Called on the I/O thread.
+		std::optional<std::chrono::steady_clock::time_point> CheckTimeouts(std::chrono::steady_clock::time_point now);
+
+#ifdef SOCKETS_IO_URING
+		// Shares the pool, so the slot can still be returned when this
+		// connection outlives its server or client.
+		void SetRegisteredHeaders(std::shared_ptr<RegisteredHeaders<Data>> headers);
+#endif
 		uint32_t GetId() const;
 
 		void ConnectToClient(sockets::ServerInterface<Data>* server, uint32_t id = 0);
@@ -52,33 +161,129 @@ namespace sockets
 		Owner m_owner = Owner::Server;
 		asio::ip::tcp::socket m_socket;
 		asio::io_context& m_asioContext;
-		ThreadSafeQueue<message<Data>> m_messagesOut;
+		ConnectionSettings m_settings;
+		struct OutgoingMessage
+		{
+			message<Data> msg;
+			ChunkProducer producer;
+#ifdef SOCKETS_TRACING
+			int64_t enqueued = 0;
+#endif
+			// Set once the producer has handed out its last chunk.
+			bool produced = false;
+		};
+
+		// Only touched on the I/O thread. Allocated by the first Send and freed
+		// once every lane has drained, so idle connections carry no queues. A lane
+		// is a vector consumed from head: unlike a deque, an empty one allocates
+		// nothing, so a burst of one message costs two allocations in total.
+		struct OutboundLanes
+		{
+			std::array<std::vector<OutgoingMessage>, PriorityLanes> messages;
+			std::array<size_t, PriorityLanes> head{};
+			std::array<size_t, PriorityLanes> sentOffset{};
+			std::array<std::vector<uint8_t>, PriorityLanes> streamChunk;
+
+			bool Empty(size_t lane) const { return head[lane] == messages[lane].size(); }
+
+			size_t Size() const
+			{
+				size_t size = 0;
+				for (size_t lane = 0; lane < PriorityLanes; ++lane)
+					size += messages[lane].size() - head[lane];
+				return size;
+			}
+
+			OutgoingMessage& Front(size_t lane) { return messages[lane][head[lane]]; }
+
+			void PopFront(size_t lane)
+			{
+				auto& queue = messages[lane];
+				queue[head[lane]++] = {};
+
+				// Compact once the consumed part dominates, which keeps pops amortized O(1).
+				if (head[lane] == queue.size())
+				{
+					queue.clear();
+					head[lane] = 0;
+				}
+				else if (head[lane] * 2 >= queue.size())
+				{
+					queue.erase(queue.begin(), queue.begin() + static_cast<std::ptrdiff_t>(head[lane]));
+					head[lane] = 0;
+				}
+			}
+		};
+
+		std::unique_ptr<OutboundLanes> m_messagesOut;
 		ThreadSafeQueue<owned_message<Data>>& m_messagesIn;
 
 		uint64_t m_handShakeOut{ 0 };
 		uint64_t m_handShakeIn{ 0 };
 		uint64_t m_handShakeCheck{ 0 };
+		uint8_t m_capabilitiesOut{ 0 };
+		uint8_t m_capabilitiesIn{ 0 };
 		std::atomic_bool m_testPassed{ false };
+		bool m_validated = false;
+
+		std::chrono::steady_clock::time_point m_created = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point m_lastReceived = m_created;
+		std::chrono::steady_clock::time_point m_lastSent = m_created;
 
 	private:
+		void Close();
+
 		void ReadHeader();
 
+		void HandleHeader(std::error_code errorCode);
+
 		void ReadBody();
 
-		void WriteHeader();
+#ifdef SOCKETS_TRACING
+		void ReadTrace();
+#endif
+
+		void Enqueue(Priority priority, OutgoingMessage outgoing);
+
+		void WriteFrame();
 
-		void WriteBody();
+		std::optional<size_t> NextLane() const;
 
 		void AddToIncomingMessageQueue();
 
 		message<Data> m_temporaryMessageIn;
+		std::array<std::vector<uint8_t>, PriorityLanes> m_fragmentsIn;
+		std::shared_ptr<const ChunkHandlers> m_streamHandlers;
+		MessageHandler m_messageHandler;
+		CloseHandler m_closeHandler;
+
+#ifdef SOCKETS_IO_URING
+		std::shared_ptr<RegisteredHeaders<Data>> m_registeredHeaders;
+		std::optional<size_t> m_headerSlot;
+#endif
+
+		message_header<Data> m_headerOut{};
+		bool m_writing = false;
+		bool m_writeReady = false;
+		bool m_preamblePending = false;
+
+#ifdef SOCKETS_TRACING
+		trace_stamps m_traceOut{};
+		trace_stamps m_traceIn{};
+		uint32_t m_traceCounter = 0;
+#endif
 	};
 
 	template <typename Data>
 	Connection<Data>::Connection(Owner owner, asio::io_context& asioContext, asio::ip::tcp::socket socket,
-		ThreadSafeQueue<owned_message<Data>>& messageQueue):
-		m_owner(owner), m_socket(std::move(socket)), m_asioContext(asioContext), m_messagesIn(messageQueue)
+		ThreadSafeQueue<owned_message<Data>>& messageQueue, ConnectionSettings settings):
+		m_owner(owner), m_socket(std::move(socket)), m_asioContext(asioContext), m_settings(settings), m_messagesIn(messageQueue)
 	{
+#ifdef SOCKETS_TRACING
+		if (m_owner == Owner::Server || m_settings.dispatch == ConnectionSettings::Dispatch::Inline)
+			m_capabilitiesOut |= CapabilityTrace;
+#endif
+
 		if (m_owner == Owner::Server)
 		{
 			m_handShakeOut = static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
@@ -92,6 +297,15 @@ namespace sockets
 		}
 	}
 
+	template <typename Data>
+	Connection<Data>::~Connection()
+	{
+#ifdef SOCKETS_IO_URING
+		if (m_headerSlot)
+			m_registeredHeaders->Release(*m_headerSlot);
+#endif
+	}
+
 	template <typename Data>
 	void Connection<Data>::ConnectToServer(const asio::ip::tcp::resolver::results_type& endPoints)
 	{
@@ -104,6 +318,15 @@ namespace sockets
 				                    {
 					                    ReadValidation();
 				                    }
+				                    else
+				                    {
+					                    std::cout << "[CLIENT] Connect Fail." << std::endl;
+					                    std::cout << errorCode.message() << std::endl;
+
+					                    // Nothing will ever be written; stop queueing.
+					                    m_writeReady = true;
+					                    m_messagesOut.reset();
+				                    }
 			                    });
 		}
 	}
@@ -122,19 +345,115 @@ namespace sockets
 	}
 
 	template <typename Data>
-	void Connection<Data>::Send(const message<Data>& msg)
+	void Connection<Data>::Send(const message<Data>& msg, Priority priority)
 	{
-		asio::post(m_asioContext, [this, msg]()
+#ifdef SOCKETS_TRACING
+		asio::post(m_asioContext, [this, msg, priority, enqueued = TraceNow()]()
 		{
-			bool alreadyWriting = !m_messagesOut.empty();
-			m_messagesOut.push_back(msg);
-			if (!alreadyWriting)
-			{
-				WriteHeader();
-			}
+			const bool sampled = m_settings.traceSampleEvery > 0 && (m_capabilitiesIn & CapabilityTrace) && m_traceCounter++ % m_settings.traceSampleEvery == 0;
+			Enqueue(priority, { msg, nullptr, sampled ? enqueued : 0 });
+		});
+#else
+		asio::post(m_asioContext, [this, msg, priority]()
+		{
+			Enqueue(priority, { msg, nullptr });
+		});
+#endif
+	}
+
+	template <typename Data>
+	void Connection<Data>::SendStream(Data id, ChunkProducer producer, Priority priority)
+	{
+		asio::post(m_asioContext, [this, id, producer = std::move(producer), priority]() mutable
+		{
+			OutgoingMessage outgoing{ {}, std::move(producer) };
+			outgoing.msg.header.id = id;
+
+			Enqueue(priority, std::move(outgoing));
 		});
 	}
 
+	template <typename Data>
+	void Connection<Data>::SetStreamHandlers(std::shared_ptr<const ChunkHandlers> handlers)
+	{
+		m_streamHandlers = std::move(handlers);
+	}
+
+	template <typename Data>
+	void Connection<Data>::SetMessageHandler(MessageHandler handler)
+	{
+		m_messageHandler = std::move(handler);
+	}
+
+	template <typename Data>
+	void Connection<Data>::SetCloseHandler(CloseHandler handler)
+	{
+		m_closeHandler = std::move(handler);
+	}
+
+	template <typename Data>
+	void Connection<Data>::Close()
+	{
+		if (!m_socket.is_open())
+			return;
+
+		m_socket.close();
+
+		if (m_closeHandler)
+			m_closeHandler(this->shared_from_this());
+	}
+
+	template <typename Data>
+	std::optional<std::chrono::steady_clock::time_point> Connection<Data>::CheckTimeouts(std::chrono::steady_clock::time_point now)
+	{
+		if (!m_socket.is_open())
+			return std::nullopt;
+
+		const auto& settings = m_settings;
+		if (!m_validated && settings.handshakeTimeout.count() > 0 && now - m_created >= settings.handshakeTimeout)
+		{
+			std::cout << "[" << m_id << "] Handshake Timeout." << std::endl;
+			m_socket.close();
+			return std::nullopt;
+		}
+
+		if (settings.idleTimeout.count() > 0 && now - m_lastReceived >= settings.idleTimeout)
+		{
+			std::cout << "[" << m_id << "] Idle Timeout." << std::endl;
+			m_socket.close();
+			return std::nullopt;
+		}
+
+		if (m_validated && settings.heartbeatInterval.count() > 0 && now - m_lastSent >= settings.heartbeatInterval)
+		{
+			OutgoingMessage heartbeat{};
+			heartbeat.msg.header.flags = FrameHeartbeat;
+			m_lastSent = now;
+			Enqueue(Priority::High, std::move(heartbeat));
+		}
+
+		auto next = std::chrono::steady_clock::time_point::max();
+		if (!m_validated && settings.handshakeTimeout.count() > 0)
+			next = std::min(next, m_created + settings.handshakeTimeout);
+		if (settings.idleTimeout.count() > 0)
+			next = std::min(next, m_lastReceived + settings.idleTimeout);
+		if (settings.heartbeatInterval.count() > 0)
+			next = std::min(next, m_lastSent + settings.heartbeatInterval);
+		return next;
+	}
+
+#ifdef SOCKETS_IO_URING
+	template <typename Data>
+	void Connection<Data>::SetRegisteredHeaders(std::shared_ptr<RegisteredHeaders<Data>> headers)
+	{
+		if (m_headerSlot)
+			m_registeredHeaders->Release(*m_headerSlot);
+
+		m_registeredHeaders = std::move(headers);
+		m_headerSlot = m_registeredHeaders ? m_registeredHeaders->Acquire() : std::nullopt;
+	}
+#endif
+
 	template <typename Data>
 	uint32_t Connection<Data>::GetId() const
 	{ return m_id; }
@@ -172,28 +491,25 @@ namespace sockets
 	template <typename Data>
 	void Connection<Data>::WriteValidation()
 	{
-		asio::async_write(m_socket, asio::buffer(&m_handShakeOut, sizeof(uint64_t)),
-		                  [this](std::error_code errorCode, std::size_t length)
-		                  {
-			                  if (!errorCode)
-			                  {
-				                  if (m_owner == Owner::Client)
-				                  {
-					                  ReadHeader();
-					                  m_testPassed = true;
-				                  }
-			                  }
-			                  else
-			                  {
-				                  m_socket.close();
-			                  }
-		                  });
+		// Goes out in front of anything already queued, see WriteFrame.
+		m_preamblePending = true;
+		m_writeReady = true;
+
+		if (!m_writing)
+		{
+			WriteFrame();
+		}
 	}
 
 	template <typename Data>
 	void Connection<Data>::ReadValidation(ServerInterface<Data>* server)
 	{
-		asio::async_read(m_socket, asio::buffer(&m_handShakeIn, sizeof(uint64_t)),
+		const std::array<asio::mutable_buffer, 2> buffers{
+			asio::buffer(&m_handShakeIn, sizeof(uint64_t)),
+			asio::buffer(&m_capabilitiesIn, sizeof(uint8_t))
+		};
+
+		asio::async_read(m_socket, buffers,
 		                 [this, server](std::error_code errorCode, std::size_t length)
 		                 {
 			                 if (!errorCode)
@@ -203,24 +519,26 @@ namespace sockets
 					                 if (m_handShakeIn == m_handShakeCheck)
 					                 {
 						                 std::cout << "Client Validated" << std::endl;
+						                 m_validated = true;
 						                 server->OnClientValidated(this->shared_from_this());
 						                 ReadHeader();
 					                 }
 					                 else
 					                 {
 						                 std::cout << "Client Disconnected (Fail Validation)" << std::endl;
-						                 m_socket.close();
+						                 Close();
 					                 }
 				                 }
 				                 else
 				                 {
 					                 m_handShakeOut = Encrypt(m_handShakeIn);
 					                 WriteValidation();
+					                 ReadHeader();
 				                 }
 			                 }
 			                 else
 			                 {
-				                 m_socket.close();
+				                 Close();
 			                 }
 		                 });
 	}
@@ -228,103 +546,368 @@ namespace sockets
 	template <typename Data>
 	void Connection<Data>::ReadHeader()
 	{
+#ifdef SOCKETS_IO_URING
+		if (m_headerSlot)
+		{
+			asio::async_read(m_socket, m_registeredHeaders->Buffer(*m_headerSlot),
+				[this](std::error_code errorCode, std::size_t length)
+				{
+					m_temporaryMessageIn.header = m_registeredHeaders->Header(*m_headerSlot);
+					HandleHeader(errorCode);
+				});
+			return;
+		}
+#endif
 		asio::async_read(m_socket, asio::buffer(&m_temporaryMessageIn.header, sizeof(message_header<Data>)), 
 		                 [this](std::error_code errorCode, std::size_t length)
 		                 {
-			                 if (!errorCode)
-			                 {
-				                 if (m_temporaryMessageIn.header.size > 0)
-				                 {
-					                 m_temporaryMessageIn.body.resize(m_temporaryMessageIn.header.size);
-					                 ReadBody();
-				                 }
-				                 else
-				                 {
-					                 AddToIncomingMessageQueue();
-				                 }
-			                 }
-			                 else
-			                 {
-				                 std::cout << "[" << m_id << "] Read Header Fail." << std::endl;
-				                 std::cout << errorCode.message() << std::endl;
-				                 m_socket.close();
-			                 }
+			                 HandleHeader(errorCode);
 		                 });
 	}
 
+	template <typename Data>
+	void Connection<Data>::HandleHeader(std::error_code errorCode)
+	{
+		if (!errorCode)
+		{
+			m_lastReceived = std::chrono::steady_clock::now();
+
+			if (m_temporaryMessageIn.header.lane >= PriorityLanes)
+			{
+				std::cout << "[" << m_id << "] Invalid Lane." << std::endl;
+				Close();
+				return;
+			}
+
+			if (m_temporaryMessageIn.header.size > m_settings.maxFrameSize)
+			{
+				std::cout << "[" << m_id << "] Frame Too Large (" << m_temporaryMessageIn.header.size << " bytes)." << std::endl;
+				Close();
+				return;
+			}
+
+			if (m_temporaryMessageIn.header.flags & FrameHeartbeat)
+			{
+				if (m_temporaryMessageIn.header.size != 0)
+				{
+					std::cout << "[" << m_id << "] Invalid Heartbeat." << std::endl;
+					Close();
+					return;
+				}
+
+				ReadHeader();
+				return;
+			}
+
+			m_temporaryMessageIn.body.resize(m_temporaryMessageIn.header.size);
+
+			if (m_temporaryMessageIn.header.flags & FrameTraced)
+			{
+#ifdef SOCKETS_TRACING
+				if (m_capabilitiesOut & CapabilityTrace)
+				{
+					ReadTrace();
+					return;
+				}
+#endif
+				std::cout << "[" << m_id << "] Unexpected Trace Stamps." << std::endl;
+				Close();
+				return;
+			}
+
+			ReadBody();
+		}
+		else
+		{
+			std::cout << "[" << m_id << "] Read Header Fail." << std::endl;
+			std::cout << errorCode.message() << std::endl;
+			Close();
+		}
+	}
+
 	template <typename Data>
 	void Connection<Data>::ReadBody()
 	{
+		if (m_temporaryMessageIn.body.empty())
+		{
+			AddToIncomingMessageQueue();
+			return;
+		}
+
 		asio::async_read(m_socket, asio::buffer(m_temporaryMessageIn.body.data(), m_temporaryMessageIn.body.size()), 
 		                 [this](std::error_code errorCode, std::size_t length)
 		                 {
 			                 if (!errorCode)
 			                 {
+				                 m_lastReceived = std::chrono::steady_clock::now();
 				                 AddToIncomingMessageQueue();
 			                 }
 			                 else
 			                 {
 				                 std::cout << "[" << m_id << "] Read Body Fail." << std::endl;
 				                 std::cout << errorCode.message() << std::endl;
-				                 m_socket.close();
+				                 Close();
 			                 }
 		                 });
 	}
 
+#ifdef SOCKETS_TRACING
+	template <typename Data>
+	void Connection<Data>::ReadTrace()
+	{
+		asio::async_read(m_socket, asio::buffer(&m_traceIn, sizeof(trace_stamps)),
+			[this](std::error_code errorCode, std::size_t length)
+			{
+				if (!errorCode)
+				{
+					ReadBody();
+				}
+				else
+				{
+					std::cout << "[" << m_id << "] Read Trace Fail." << std::endl;
+					std::cout << errorCode.message() << std::endl;
+					Close();
+				}
+			});
+	}
+#endif
+
+	template <typename Data>
+	std::optional<size_t> Connection<Data>::NextLane() const
+	{
+		for (size_t lane = 0; lane < PriorityLanes; ++lane)
+		{
+			if (!m_messagesOut->Empty(lane))
+				return lane;
+		}
+		return std::nullopt;
+	}
+
 	template <typename Data>
-	void Connection<Data>::WriteHeader()
+	void Connection<Data>::Enqueue(Priority priority, OutgoingMessage outgoing)
 	{
-		asio::async_write(m_socket, asio::buffer(&m_messagesOut.front().header, sizeof(message_header<Data>)),
-		                  [this](std::error_code errorCode, std::size_t length)
-		                  {
-			                  if (!errorCode)
-			                  {
-				                  if (m_messagesOut.front().body.size() > 0)
-				                  {
-					                  WriteBody();
-				                  }
-				                  else
-				                  {
-					                  m_messagesOut.pop_front();
-
-					                  if (!m_messagesOut.empty())
-					                  {
-						                  WriteHeader();
-					                  }
-				                  }
-			                  }
-		                  });
+		if (m_writeReady && !m_socket.is_open())
+			return;
 
+		if (!m_writeReady && m_messagesOut && m_messagesOut->Size() >= m_settings.maxEarlyMessages)
+		{
+			std::cout << "[CLIENT] Early Message Dropped." << std::endl;
+			return;
+		}
+
+		if (!m_messagesOut)
+		{
+			m_messagesOut = std::make_unique<OutboundLanes>();
+		}
+
+		m_messagesOut->messages[static_cast<size_t>(priority)].push_back(std::move(outgoing));
+
+		// Before WriteValidation the messages only queue up; they are written
+		// right behind the validation value once it is known.
+		if (m_writeReady && !m_writing)
+		{
+			WriteFrame();
+		}
 	}
 
 	template <typename Data>
-	void Connection<Data>::WriteBody()
+	void Connection<Data>::WriteFrame()
 	{
-		asio::async_write(m_socket, asio::buffer(&m_messagesOut.front().header, sizeof(message_header<Data>)),
-		                  [this](std::error_code errorCode, std::size_t length)
-		                  {
-			                  if (!errorCode)
-			                  {
-				                  m_messagesOut.pop_front();
-
-				                  if (!m_messagesOut.empty())
-				                  {
-					                  WriteHeader();
-				                  }
-			                  }
-			                  else
-			                  {
-				                  std::cout << "[" << m_id << "] Write Body Fail." << std::endl;
-				                  std::cout << errorCode.message() << std::endl;
-				                  m_socket.close();
-			                  }
-		                  });
+		const auto lane = m_messagesOut ? NextLane() : std::nullopt;
+		const bool preamble = m_preamblePending;
+		if (!lane && !preamble)
+		{
+			m_writing = false;
+			m_messagesOut.reset();
+			return;
+		}
+
+		m_writing = true;
+
+#ifdef SOCKETS_TRACING
+		std::array<asio::const_buffer, 5> buffers{};
+#else
+		std::array<asio::const_buffer, 4> buffers{};
+#endif
+		size_t count = 0;
+		size_t chunk = 0;
+		bool more = false;
+
+		// The validation value shares the write with the first frame, so early
+		// messages reach the peer without waiting for another round trip.
+		if (preamble)
+		{
+			buffers[count++] = asio::buffer(&m_handShakeOut, sizeof(uint64_t));
+			buffers[count++] = asio::buffer(&m_capabilitiesOut, sizeof(uint8_t));
+		}
+
+		if (lane)
+		{
+			// Every frame is a header followed by at most maxChunkSize bytes of the
+			// front message of the chosen lane. A partially sent message keeps its
+			// offset, so a higher lane can cut in at the next frame boundary.
+			// Producer chunks are split the same way, the offset then points into
+			// the chunk the producer handed out last.
+			auto& outgoing = m_messagesOut->Front(*lane);
+			const auto& msg = outgoing.msg;
+			const size_t offset = m_messagesOut->sentOffset[*lane];
+			const std::vector<uint8_t>* source = &msg.body;
+
+			if (outgoing.producer)
+			{
+				source = &m_messagesOut->streamChunk[*lane];
+				if (offset == 0)
+				{
+					auto& streamChunk = m_messagesOut->streamChunk[*lane];
+					streamChunk.clear();
+					outgoing.produced = !outgoing.producer(streamChunk);
+				}
+			}
+
+			chunk = source->size() - offset;
+			if (m_settings.maxChunkSize > 0)
+				chunk = std::min<size_t>(chunk, m_settings.maxChunkSize);
+			const uint8_t* data = source->data() + offset;
+			more = offset + chunk < source->size() || (outgoing.producer && !outgoing.produced);
+
+			if (chunk > std::numeric_limits<uint32_t>::max())
+			{
+				std::cout << "[" << m_id << "] Chunk Too Large (" << chunk << " bytes)." << std::endl;
+				m_writing = false;
+				m_messagesOut.reset();
+				Close();
+				return;
+			}
+
+			m_headerOut = msg.header;
+			m_headerOut.size = static_cast<uint32_t>(chunk);
+			m_headerOut.lane = static_cast<uint8_t>(*lane);
+			m_headerOut.flags = (more ? FrameMoreFragments : 0) | (msg.header.flags & FrameHeartbeat);
+			buffers[count++] = asio::buffer(&m_headerOut, sizeof(message_header<Data>));
+
+#ifdef SOCKETS_TRACING
+			// Stamps ride on the last frame of a sampled message; "written" is the
+			// moment that frame is handed to the socket.
+			if (!more && outgoing.enqueued != 0)
+			{
+				m_headerOut.flags |= FrameTraced;
+				m_traceOut = { outgoing.enqueued, TraceNow() };
+				buffers[count++] = asio::buffer(&m_traceOut, sizeof(trace_stamps));
+			}
+#endif
+
+			buffers[count++] = asio::buffer(data, chunk);
+		}
+
+		asio::async_write(m_socket, buffers,
+			[this, lane, chunk, more, preamble](std::error_code errorCode, std::size_t length)
+			{
+				if (!errorCode)
+				{
+					m_lastSent = std::chrono::steady_clock::now();
+
+					if (preamble)
+					{
+						m_preamblePending = false;
+						if (m_owner == Owner::Client)
+						{
+							m_validated = true;
+							m_testPassed = true;
+						}
+					}
+
+					if (lane)
+					{
+						auto& offset = m_messagesOut->sentOffset[*lane];
+						offset += chunk;
+						if (!more)
+						{
+							m_messagesOut->PopFront(*lane);
+							offset = 0;
+						}
+						else if (m_messagesOut->Front(*lane).producer && offset == m_messagesOut->streamChunk[*lane].size())
+						{
+							// Ask the producer for the next chunk.
+							offset = 0;
+						}
+					}
+
+					WriteFrame();
+				}
+				else
+				{
+					std::cout << "[" << m_id << "] Write Frame Fail." << std::endl;
+					std::cout << errorCode.message() << std::endl;
+					m_writing = false;
+					m_messagesOut.reset();
+					Close();
+				}
+			});
 	}
 
 	template <typename Data>
 	void Connection<Data>::AddToIncomingMessageQueue()
 	{
-		m_messagesIn.push_back({ m_owner == Owner::Server ? this->shared_from_this() : nullptr, m_temporaryMessageIn });
+		const auto& header = m_temporaryMessageIn.header;
+		auto& fragments = m_fragmentsIn[header.lane];
+		auto& body = m_temporaryMessageIn.body;
+
+		const auto handler = m_streamHandlers ? m_streamHandlers->find(header.id) : typename ChunkHandlers::const_iterator{};
+		if (m_streamHandlers && handler != m_streamHandlers->end())
+		{
+			const bool last = !(header.flags & FrameMoreFragments);
+			handler->second(m_owner == Owner::Server ? this->shared_from_this() : nullptr, header, body, last);
+
+			if (last)
+				std::vector<uint8_t>().swap(body);
+
+			ReadHeader();
+			return;
+		}
+
+		if (fragments.size() + body.size() > m_settings.maxMessageSize)
+		{
+			std::cout << "[" << m_id << "] Message Too Large." << std::endl;
+			Close();
+			return;
+		}
+
+		if (header.flags & FrameMoreFragments)
+		{
+			if (fragments.empty())
+				fragments.swap(body);
+			else
+				fragments.insert(fragments.end(), body.begin(), body.end());
+
+			ReadHeader();
+			return;
+		}
+
+		if (!fragments.empty())
+		{
+			fragments.insert(fragments.end(), body.begin(), body.end());
+			body.swap(fragments);
+			std::vector<uint8_t>().swap(fragments);
+			m_temporaryMessageIn.header.size = static_cast<uint32_t>(body.size());
+		}
+
+		owned_message<Data> message{ m_owner == Owner::Server ? this->shared_from_this() : nullptr, std::move(m_temporaryMessageIn) };
+
+#ifdef SOCKETS_TRACING
+		if (message.msg.header.flags & FrameTraced)
+		{
+			message.trace.id = static_cast<uint32_t>(message.msg.header.id);
+			message.trace.connection = m_id;
+			message.trace.enqueued = m_traceIn.enqueued;
+			message.trace.written = m_traceIn.written;
+			message.trace.read = TraceNow();
+		}
+#endif
+
+		if (m_messageHandler)
+			m_messageHandler(std::move(message));
+		else
+			m_messagesIn.push_back(std::move(message));
 
 		ReadHeader();
 	}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "CommonIncludes.h"
+#include "Message.hpp"
+
+#if defined(SOCKETS_IO_URING) && defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace sockets
+{
+	inline const char* IoBackendName()
+	{
+#if defined(ASIO_HAS_IO_URING) && defined(ASIO_DISABLE_EPOLL)
+		return "io_uring";
+#elif defined(__linux__)
+		return "epoll";
+#else
+		return "native";
+#endif
+	}
+
+#ifdef SOCKETS_IO_URING
+	// True when the running kernel lets this process create an io_uring.
+	// asio picks its reactor at compile time, so an io_uring build cannot fall
+	// back to epoll in-process; launchers use this to choose which build to run.
+	inline bool IoUringAvailable()
+	{
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+		io_uring_params params{};
+		const long fd = syscall(__NR_io_uring_setup, 1, &params);
+		if (fd < 0)
+			return false;
+
+		close(static_cast<int>(fd));
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// The kernel refuses to register more buffers than this with one ring.
+	inline constexpr size_t MaxRegisteredBuffers = 16384;
+
+	// Header slots registered once with the ring of an io_context. Every
+	// connection borrows one for its header reads, which then go out as fixed
+	// buffer reads instead of having the kernel map a fresh user buffer each
+	// time. Connections that find the pool empty use their own header.
+	template <typename Data>
+	class RegisteredHeaders
+	{
+	public:
+		RegisteredHeaders(asio::io_context& context, size_t count) :
+			m_headers(std::min(count, MaxRegisteredBuffers)),
+			m_registration(asio::register_buffers(context, Buffers(m_headers)))
+		{
+			m_free.reserve(m_headers.size());
+			for (size_t slot = m_headers.size(); slot > 0; --slot)
+				m_free.push_back(slot - 1);
+		}
+
+		RegisteredHeaders(const RegisteredHeaders&) = delete;
+		RegisteredHeaders& operator=(const RegisteredHeaders&) = delete;
+
+		std::optional<size_t> Acquire()
+		{
+			std::lock_guard lock(m_mutex);
+			if (m_free.empty())
+				return std::nullopt;
+
+			const size_t slot = m_free.back();
+			m_free.pop_back();
+			return slot;
+		}
+
+		void Release(size_t slot)
+		{
+			std::lock_guard lock(m_mutex);
+			m_free.push_back(slot);
+		}
+
+		asio::mutable_registered_buffer Buffer(size_t slot) { return m_registration[slot]; }
+
+		const message_header<Data>& Header(size_t slot) const { return m_headers[slot]; }
+
+	private:
+		static std::vector<asio::mutable_buffer> Buffers(std::vector<message_header<Data>>& headers)
+		{
+			std::vector<asio::mutable_buffer> buffers;
+			buffers.reserve(headers.size());
+			for (auto& header : headers)
+				buffers.push_back(asio::buffer(&header, sizeof(message_header<Data>)));
+			return buffers;
+		}
+
+		std::vector<message_header<Data>> m_headers;
+		asio::buffer_registration<std::vector<asio::mutable_buffer>> m_registration;
+
+		std::mutex m_mutex;
+		std::vector<size_t> m_free;
+	};
+#endif
+}
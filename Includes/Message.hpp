@@ -1,14 +1,45 @@
 #pragma once
 
 #include "CommonIncludes.h"
+#include "Trace.hpp"
 
 namespace sockets
 {
+    // Outbound lanes, highest priority first. The writer always drains the
+    // highest non-empty lane at the next frame boundary.
+    enum class Priority : uint8_t
+    {
+        High,
+        Normal,
+        Low
+    };
+
+    inline constexpr size_t PriorityLanes = 3;
+
+    // Set on every fragment of a chunked body except the last one.
+    inline constexpr uint8_t FrameMoreFragments = 0x01;
+
+    // A trace_stamps block follows the header. Only sent to peers that
+    // advertised tracing during the handshake.
+    inline constexpr uint8_t FrameTraced = 0x02;
+
+    // Empty keep-alive frame. Refreshes the peer's idle timer and is never
+    // delivered to OnMessage.
+    inline constexpr uint8_t FrameHeartbeat = 0x04;
+
+    struct trace_stamps
+    {
+        int64_t enqueued = 0;
+        int64_t written = 0;
+    };
+
     template <typename Type>
     struct message_header
     {
         Type id{};
         uint32_t size = 0;
+        uint8_t lane = static_cast<uint8_t>(Priority::Normal);
+        uint8_t flags = 0;
     };
 
     template <typename Type>
@@ -36,7 +67,7 @@ namespace sockets
             size_t size = msg.body.size();
             msg.body.resize(msg.body.size() + sizeof(DataType));
             memcpy(msg.body.data() + size, &data, sizeof(DataType));
-            msg.header.size = static_cast<decltype(msg.header.size)>(msg.size());
+            msg.header.size = static_cast<decltype(msg.header.size)>(msg.body.size());
             return msg;
         }
 
@@ -47,7 +78,7 @@ namespace sockets
             size_t it = msg.body.size() - sizeof(DataType);
             memcpy(&data, msg.body.data() + it, sizeof(DataType));
             msg.body.resize(it);
-            msg.header.size = static_cast<decltype(msg.header.size)>(msg.size());
+            msg.header.size = static_cast<decltype(msg.header.size)>(msg.body.size());
             return msg;
         }
     };
@@ -60,6 +91,9 @@ namespace sockets
     {
         std::shared_ptr<Connection<Type>> remote = nullptr;
         message<Type> msg;
+#ifdef SOCKETS_TRACING
+        TraceSpan trace{};
+#endif
 
         friend std::ostream& operator << (std::ostream& stream, const owned_message<Type>& msg)
         {
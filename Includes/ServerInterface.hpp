@@ -4,6 +4,7 @@
 #include "ThreadSafeQueue.hpp"
 #include "Message.hpp"
 #include "Connection.hpp"
+#include "TimerWheel.hpp"
 
 namespace sockets
 {
@@ -11,8 +12,11 @@ namespace sockets
 	class ServerInterface
 	{
 	public:
-		ServerInterface(uint16_t port);
+		ServerInterface(uint16_t port, ConnectionSettings settings = {});
 
+		// The I/O thread calls the virtual On* callbacks until Stop returns, so a
+		// derived class has to call Stop from its own destructor; by the time this
+		// one runs, the overrides are already gone.
 		virtual ~ServerInterface();
 
 		ServerInterface(ServerInterface&) = delete;
@@ -27,9 +31,24 @@ namespace sockets
 		void WaitForClientConnection();
 
 		void MessageClient(std::shared_ptr<Connection<Data>> client, const message<Data>& msg);
+		void MessageClient(std::shared_ptr<Connection<Data>> client, const message<Data>& msg, Priority priority);
 
 		void MessageAllClients(const message<Data>& msg, std::shared_ptr<Connection<Data>> clientToIgnore = nullptr);
+		void MessageAllClients(const message<Data>& msg, Priority priority, std::shared_ptr<Connection<Data>> clientToIgnore = nullptr);
 
+		void StreamClient(std::shared_ptr<Connection<Data>> client, Data id, typename Connection<Data>::ChunkProducer producer,
+			Priority priority = Priority::Low);
+
+		// Ids without a priority go out on Priority::Normal. The map is read on
+		// the I/O thread in inline mode and is not locked; must be set before Start.
+		void SetPriority(Data id, Priority priority);
+		Priority PriorityOf(Data id) const;
+
+		// Bodies with this id bypass reassembly and OnMessage; must be set before Start.
+		void SetStreamHandler(Data id, typename Connection<Data>::ChunkHandler handler);
+
+		// With Dispatch::Inline nothing is queued: Update returns at once, or with
+		// wait set blocks until Stop so a wait loop does not spin.
 		void Update(size_t maxMessages = std::numeric_limits<size_t>::max(), bool wait = false);
 
 		virtual bool OnClientConnect(std::shared_ptr<Connection<Data>> client) = 0;
@@ -38,12 +57,34 @@ namespace sockets
 		virtual void OnClientValidated(std::shared_ptr<Connection<Data>> client) = 0;
 
 	protected:
+		void DispatchInline(owned_message<Data>&& message);
+
+		// Returns false when the client was already removed by someone else, so
+		// OnClientDisconnect is reported exactly once.
+		bool RemoveConnection(const std::shared_ptr<Connection<Data>>& client);
+
+		// Removes a connection the I/O thread closed and reports it. Called on
+		// the I/O thread when timers are in use.
+		void ReapConnection(std::shared_ptr<Connection<Data>> client);
+
+		ConnectionSettings m_settings;
+		std::map<Data, Priority> m_priorities;
+		std::shared_ptr<typename Connection<Data>::ChunkHandlers> m_streamHandlers = std::make_shared<typename Connection<Data>::ChunkHandlers>();
+
 		ThreadSafeQueue<sockets::owned_message<Data>> m_messagesIn;
 
 		std::deque<std::shared_ptr<Connection<Data>>> m_connections;
+		std::mutex m_connectionsMutex;
 
 		asio::io_context m_asioContext;
 		std::jthread m_threadContext;
+		std::atomic_bool m_stopped{ false };
+
+		std::unique_ptr<ConnectionTimers<Data>> m_timers;
+
+#ifdef SOCKETS_IO_URING
+		std::shared_ptr<RegisteredHeaders<Data>> m_registeredHeaders;
+#endif
 
 		asio::ip::tcp::acceptor m_asioAcceptor;
 
@@ -51,16 +92,38 @@ namespace sockets
 	};
 
 	template <typename Data>
-	ServerInterface<Data>::ServerInterface(uint16_t port): 
+	ServerInterface<Data>::ServerInterface(uint16_t port, ConnectionSettings settings): 
+		m_settings(settings),
 		m_asioAcceptor(m_asioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
 	{
+		if (m_settings.UsesTimers())
+		{
+			m_timers = std::make_unique<ConnectionTimers<Data>>(m_asioContext, m_settings.timerTick,
+				[this](std::shared_ptr<Connection<Data>> client)
+				{
+					ReapConnection(std::move(client));
+				});
+		}
 
+#ifdef SOCKETS_IO_URING
+		m_registeredHeaders = std::make_shared<RegisteredHeaders<Data>>(m_asioContext, m_settings.registeredHeaderSlots);
+#endif
 	}
 
 	template <typename Data>
 	ServerInterface<Data>::~ServerInterface()
 	{
 		Stop();
+
+		// Sockets have to go before the io_context that owns them, including the
+		// ones only kept alive by messages nobody took out of the queue.
+		m_connections.clear();
+		m_messagesIn.clear();
+#ifdef SOCKETS_IO_URING
+		// Connections still held by pending handlers keep the pool alive until
+		// the io_context destroys those handlers.
+		m_registeredHeaders.reset();
+#endif
 	}
 
 	template <typename Data>
@@ -70,6 +133,7 @@ namespace sockets
 		{
 			WaitForClientConnection();
 
+			m_stopped = false;
 			m_threadContext = std::jthread([this]() {m_asioContext.run(); });
 		}
 		catch (const std::exception& e)
@@ -91,6 +155,9 @@ namespace sockets
 		if (m_threadContext.joinable())
 			m_threadContext.join();
 
+		m_stopped = true;
+		m_stopped.notify_all();
+
 		std::cout << "[SERVER] Stopped \n" << std::endl;
 	}
 
@@ -104,15 +171,41 @@ namespace sockets
 				{
 					std::cout << "[SERVER] New Connection: " << socket.remote_endpoint() << std::endl;
 
-					std::shared_ptr<Connection<Data>> newConnection = std::make_shared<Connection<Data>>(Connection<Data>::Owner::Server, m_asioContext, std::move(socket), m_messagesIn);
+					std::shared_ptr<Connection<Data>> newConnection = std::make_shared<Connection<Data>>(Connection<Data>::Owner::Server, m_asioContext, std::move(socket), m_messagesIn, m_settings);
+
+					newConnection->SetStreamHandlers(m_streamHandlers);
+#ifdef SOCKETS_IO_URING
+					newConnection->SetRegisteredHeaders(m_registeredHeaders);
+#endif
+					if (m_settings.dispatch == ConnectionSettings::Dispatch::Inline)
+					{
+						newConnection->SetMessageHandler([this](owned_message<Data>&& message)
+						{
+							DispatchInline(std::move(message));
+						});
+					}
+
+					if (m_timers)
+					{
+						newConnection->SetCloseHandler([this](std::shared_ptr<Connection<Data>> client)
+						{
+							ReapConnection(std::move(client));
+						});
+					}
 
 					if (OnClientConnect(newConnection))
 					{
-						m_connections.push_back(std::move(newConnection));
+						{
+							std::lock_guard lock(m_connectionsMutex);
+							m_connections.push_back(newConnection);
+						}
+
+						newConnection->ConnectToClient(this, IdCounter++);
 
-						m_connections.back()->ConnectToClient(this, IdCounter++);
+						if (m_timers)
+							m_timers->Watch(newConnection);
 
-						std::cout << "[" << m_connections.back()->GetId() << "] Connection Approved!" << std::endl;
+						std::cout << "[" << newConnection->GetId() << "] Connection Approved!" << std::endl;
 					}
 					else
 					{
@@ -130,16 +223,20 @@ namespace sockets
 
 	template <typename Data>
 	void ServerInterface<Data>::MessageClient(std::shared_ptr<Connection<Data>> client, const message<Data>& msg)
+	{
+		MessageClient(std::move(client), msg, PriorityOf(msg.header.id));
+	}
+
+	template <typename Data>
+	void ServerInterface<Data>::MessageClient(std::shared_ptr<Connection<Data>> client, const message<Data>& msg, Priority priority)
 	{
 		if (client && client->IsConnected())
 		{
-			client->Send(msg);
+			client->Send(msg, priority);
 		}
-		else
+		else if (RemoveConnection(client))
 		{
 			OnClientDisconnect(client);
-			client.reset();
-			m_connections.erase(std::ranges::remove(m_connections, client), m_connections.end());
 		}
 	}
 
@@ -147,30 +244,125 @@ namespace sockets
 	void ServerInterface<Data>::MessageAllClients(const message<Data>& msg,
 		std::shared_ptr<Connection<Data>> clientToIgnore)
 	{
-		bool invalidClient = false;
+		MessageAllClients(msg, PriorityOf(msg.header.id), std::move(clientToIgnore));
+	}
+
+	template <typename Data>
+	void ServerInterface<Data>::MessageAllClients(const message<Data>& msg, Priority priority,
+		std::shared_ptr<Connection<Data>> clientToIgnore)
+	{
+		std::vector<std::shared_ptr<Connection<Data>>> invalidClients;
 
-		for (auto& client : m_connections)
 		{
-			if (client && client->IsConnected())
-			{
-				if (client != clientToIgnore)
-					client->Send(msg);
-			}
-			else
+			std::lock_guard lock(m_connectionsMutex);
+			for (auto& client : m_connections)
 			{
-				OnClientDisconnect(client);
-				client.reset();
-				invalidClient = true;
+				if (client && client->IsConnected())
+				{
+					if (client != clientToIgnore)
+						client->Send(msg, priority);
+				}
+				else
+				{
+					invalidClients.push_back(std::move(client));
+				}
 			}
+
+			if (!invalidClients.empty())
+				m_connections.erase(std::remove(m_connections.begin(), m_connections.end(), nullptr), m_connections.end());
+		}
+
+		for (auto& client : invalidClients)
+			OnClientDisconnect(client);
+	}
+
+	template <typename Data>
+	void ServerInterface<Data>::StreamClient(std::shared_ptr<Connection<Data>> client, Data id,
+		typename Connection<Data>::ChunkProducer producer, Priority priority)
+	{
+		if (client && client->IsConnected())
+		{
+			client->SendStream(id, std::move(producer), priority);
 		}
+		else if (RemoveConnection(client))
+		{
+			OnClientDisconnect(client);
+		}
+	}
+
+	template <typename Data>
+	bool ServerInterface<Data>::RemoveConnection(const std::shared_ptr<Connection<Data>>& client)
+	{
+		std::lock_guard lock(m_connectionsMutex);
+		return std::erase(m_connections, client) > 0;
+	}
+
+	template <typename Data>
+	void ServerInterface<Data>::ReapConnection(std::shared_ptr<Connection<Data>> client)
+	{
+		// Closing the socket queued the aborted read and write handlers, which
+		// still use the connection; drop it only after they ran.
+		asio::post(m_asioContext, [this, client = std::move(client)]()
+		{
+			if (RemoveConnection(client))
+				OnClientDisconnect(client);
+		});
+	}
+
+	template <typename Data>
+	void ServerInterface<Data>::SetPriority(Data id, Priority priority)
+	{
+		m_priorities[id] = priority;
+	}
 
-		if (invalidClient)
-			m_connections.erase(std::remove(m_connections.begin(), m_connections.end(), nullptr), m_connections.end());
+	template <typename Data>
+	Priority ServerInterface<Data>::PriorityOf(Data id) const
+	{
+		const auto it = m_priorities.find(id);
+		return it != m_priorities.end() ? it->second : Priority::Normal;
+	}
+
+	template <typename Data>
+	void ServerInterface<Data>::SetStreamHandler(Data id, typename Connection<Data>::ChunkHandler handler)
+	{
+		(*m_streamHandlers)[id] = std::move(handler);
+	}
+
+	template <typename Data>
+	void ServerInterface<Data>::DispatchInline(owned_message<Data>&& message)
+	{
+#ifndef NDEBUG
+		const auto start = std::chrono::steady_clock::now();
+#endif
+#ifdef SOCKETS_TRACING
+		message.trace.dequeued = TraceNow();
+#endif
+		OnMessage(message.remote, message.msg);
+#ifdef SOCKETS_TRACING
+		if (message.trace.read != 0)
+		{
+			message.trace.handled = TraceNow();
+			Tracer().Record(message.trace);
+		}
+#endif
+#ifndef NDEBUG
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+		if (elapsed > m_settings.inlineHandlerBudget)
+		{
+			std::cout << "[" << message.remote->GetId() << "] OnMessage blocked the I/O thread for " << elapsed.count() << "us" << std::endl;
+		}
+#endif
 	}
 
 	template <typename Data>
 	void ServerInterface<Data>::Update(size_t maxMessages, bool wait)
 	{
+		if (m_settings.dispatch == ConnectionSettings::Dispatch::Inline)
+		{
+			if (wait)
+				m_stopped.wait(false);
+			return;
+		}
 
 		if (wait)
 			m_messagesIn.wait();
@@ -180,7 +372,17 @@ namespace sockets
 		{
 			auto message = m_messagesIn.pop_front();
 
+#ifdef SOCKETS_TRACING
+			message.trace.dequeued = TraceNow();
+#endif
 			OnMessage(message.remote, message.msg);
+#ifdef SOCKETS_TRACING
+			if (message.trace.read != 0)
+			{
+				message.trace.handled = TraceNow();
+				Tracer().Record(message.trace);
+			}
+#endif
 
 			messageCount++;
 		}
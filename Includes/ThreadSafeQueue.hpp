@@ -35,6 +35,15 @@ namespace sockets
             m_cvWaiting.notify_one();
         }
 
+        void push_back(DataType&& item)
+        {
+            std::lock_guard lock(m_mutex);
+            m_queue.emplace_back(std::move(item));
+
+            std::unique_lock lockMutex(m_mutexWaiting);
+            m_cvWaiting.notify_one();
+        }
+
         void push_front(const DataType& item)
         {
             std::lock_guard lock(m_mutex);
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "CommonIncludes.h"
+#include "Connection.hpp"
+
+namespace sockets
+{
+	// Hierarchical timing wheel: Levels rings of Slots buckets, each level
+	// Slots times coarser than the one below. Scheduling and firing are O(1);
+	// entries far in the future are cascaded down as their bucket comes due.
+	// Not thread safe, meant to be driven from a single I/O thread.
+	template <typename Entry>
+	class TimerWheel
+	{
+	public:
+		static constexpr size_t SlotBits = 6;
+		static constexpr size_t Slots = size_t{ 1 } << SlotBits;
+		static constexpr size_t Levels = 4;
+
+		uint64_t Now() const { return m_current; }
+
+		size_t Size() const { return m_size; }
+
+		void Schedule(uint64_t tick, Entry entry)
+		{
+			// The bucket for the current tick has already fired.
+			Place(std::max(tick, m_current + 1), std::move(entry));
+		}
+
+		// Fires every entry due up to and including tick. fire may schedule again.
+		template <typename Fire>
+		void Advance(uint64_t tick, Fire&& fire)
+		{
+			while (m_current < tick)
+			{
+				++m_current;
+
+				for (size_t level = Levels - 1; level > 0; --level)
+				{
+					if ((m_current & ((uint64_t{ 1 } << (SlotBits * level)) - 1)) == 0)
+						Cascade(level);
+				}
+
+				auto due = std::move(m_slots[0][m_current & (Slots - 1)]);
+				m_slots[0][m_current & (Slots - 1)].clear();
+				m_size -= due.size();
+
+				for (auto& pending : due)
+					fire(pending.entry);
+			}
+		}
+
+	private:
+		struct Pending
+		{
+			uint64_t tick;
+			Entry entry;
+		};
+
+		void Place(uint64_t tick, Entry&& entry)
+		{
+			constexpr uint64_t horizon = uint64_t{ 1 } << (SlotBits * Levels);
+			tick = std::clamp(tick, m_current, m_current + horizon - 1);
+
+			const uint64_t delta = tick - m_current;
+			size_t level = 0;
+			while (level < Levels - 1 && delta >= (uint64_t{ 1 } << (SlotBits * (level + 1))))
+				++level;
+
+			m_slots[level][(tick >> (SlotBits * level)) & (Slots - 1)].push_back({ tick, std::move(entry) });
+			++m_size;
+		}
+
+		void Cascade(size_t level)
+		{
+			auto& slot = m_slots[level][(m_current >> (SlotBits * level)) & (Slots - 1)];
+			auto pending = std::move(slot);
+			slot.clear();
+			m_size -= pending.size();
+
+			for (auto& entry : pending)
+				Place(entry.tick, std::move(entry.entry));
+		}
+
+		uint64_t m_current = 0;
+		size_t m_size = 0;
+		std::array<std::array<std::vector<Pending>, Slots>, Levels> m_slots;
+	};
+
+	// Heartbeat, idle and handshake deadlines for every connection of one
+	// io_context, driven by a single steady_timer ticking the wheel.
+	template <typename Data>
+	class ConnectionTimers
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+		using Expired = std::function<void(std::shared_ptr<Connection<Data>> connection)>;
+
+		ConnectionTimers(asio::io_context& asioContext, std::chrono::milliseconds tick, Expired onExpired) :
+			m_asioContext(asioContext), m_timer(asioContext), m_tick(std::max(tick, std::chrono::milliseconds(1))),
+			m_start(Clock::now()), m_onExpired(std::move(onExpired))
+		{
+			Arm();
+		}
+
+		ConnectionTimers(const ConnectionTimers&) = delete;
+		ConnectionTimers& operator=(const ConnectionTimers&) = delete;
+
+		void Watch(std::shared_ptr<Connection<Data>> connection)
+		{
+			asio::post(m_asioContext, [this, connection = std::weak_ptr(connection)]() mutable
+			{
+				m_wheel.Schedule(ToTick(Clock::now()), std::move(connection));
+			});
+		}
+
+	private:
+		uint64_t ToTick(Clock::time_point time) const
+		{
+			return time <= m_start ? 0 : static_cast<uint64_t>((time - m_start) / m_tick) + 1;
+		}
+
+		void Arm()
+		{
+			m_timer.expires_after(m_tick);
+			m_timer.async_wait([this](std::error_code errorCode)
+			{
+				if (!errorCode)
+				{
+					Tick();
+					Arm();
+				}
+			});
+		}
+
+		void Tick()
+		{
+			const auto now = Clock::now();
+			m_wheel.Advance(ToTick(now) - 1, [this, now](std::weak_ptr<Connection<Data>>& entry)
+			{
+				auto connection = entry.lock();
+				if (!connection)
+					return;
+
+				if (const auto next = connection->CheckTimeouts(now))
+				{
+					// Otherwise no deadline applies any more; stop watching.
+					if (*next != Clock::time_point::max())
+						m_wheel.Schedule(ToTick(*next), std::move(entry));
+				}
+				else if (m_onExpired)
+				{
+					m_onExpired(std::move(connection));
+				}
+			});
+		}
+
+		asio::io_context& m_asioContext;
+		asio::steady_timer m_timer;
+		std::chrono::milliseconds m_tick;
+		Clock::time_point m_start;
+		Expired m_onExpired;
+		TimerWheel<std::weak_ptr<Connection<Data>>> m_wheel;
+	};
+}
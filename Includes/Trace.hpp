@@ -0,0 +1,168 @@
+#pragma once
+
+#include "CommonIncludes.h"
+
+namespace sockets
+{
+    // One sampled message, stamped in nanoseconds of system_clock so that
+    // stamps taken by the sender and the receiver share a timeline.
+    struct TraceSpan
+    {
+        uint32_t id = 0;
+        uint32_t connection = 0;
+        int64_t enqueued = 0;
+        int64_t written = 0;
+        int64_t read = 0;
+        int64_t dequeued = 0;
+        int64_t handled = 0;
+    };
+
+    inline int64_t TraceNow()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Fixed size ring of the most recent spans. Record never blocks; a slot
+    // carries a sequence number so Snapshot can skip slots being overwritten.
+    class TraceRing
+    {
+    public:
+        static constexpr size_t Capacity = 16384;
+
+        TraceRing() = default;
+        TraceRing(const TraceRing&) = delete;
+        TraceRing& operator=(const TraceRing&) = delete;
+
+        void Record(const TraceSpan& span)
+        {
+            const uint64_t index = m_head.fetch_add(1, std::memory_order_relaxed);
+            auto& slot = m_slots[index % Capacity];
+
+            slot.sequence.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.span = span;
+            slot.sequence.store(index + 1, std::memory_order_release);
+        }
+
+        std::vector<TraceSpan> Snapshot() const
+        {
+            std::vector<TraceSpan> spans;
+            const uint64_t head = m_head.load(std::memory_order_acquire);
+            const uint64_t first = head > Capacity ? head - Capacity : 0;
+            spans.reserve(static_cast<size_t>(head - first));
+
+            for (uint64_t index = first; index < head; ++index)
+            {
+                const auto& slot = m_slots[index % Capacity];
+                const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+                const TraceSpan span = slot.span;
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (before == index + 1 && slot.sequence.load(std::memory_order_relaxed) == before)
+                    spans.push_back(span);
+            }
+            return spans;
+        }
+
+        void Clear()
+        {
+            m_head.store(0, std::memory_order_release);
+        }
+
+        // Chrome trace-event JSON (chrome://tracing, Perfetto). Each stage of a
+        // span is a complete event on the thread row of its connection.
+        void WriteChromeTrace(std::ostream& stream) const
+        {
+            const auto spans = Snapshot();
+            bool first = true;
+
+            stream << "{\"traceEvents\":[";
+            for (const auto& span : spans)
+            {
+                for (const auto& [name, begin, end] : Stages(span))
+                {
+                    if (begin == 0 || end < begin)
+                        continue;
+
+                    stream << (first ? "\n" : ",\n");
+                    stream << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << span.connection
+                        << ",\"ts\":" << static_cast<double>(begin) / 1000.0
+                        << ",\"dur\":" << static_cast<double>(end - begin) / 1000.0
+                        << ",\"args\":{\"id\":" << span.id << "}}";
+                    first = false;
+                }
+            }
+            stream << "\n]}\n";
+        }
+
+        // Power of two buckets in microseconds, one line per non-empty bucket.
+        void WriteHistograms(std::ostream& stream) const
+        {
+            constexpr size_t bucketCount = 32;
+            const auto spans = Snapshot();
+
+            for (const char* stage : { "queued-out", "wire", "queued-in", "handler" })
+            {
+                std::array<size_t, bucketCount> buckets{};
+                size_t samples = 0;
+
+                for (const auto& span : spans)
+                {
+                    for (const auto& [name, begin, end] : Stages(span))
+                    {
+                        if (std::string_view(name) != stage || begin == 0 || end < begin)
+                            continue;
+
+                        const auto micros = static_cast<uint64_t>((end - begin) / 1000);
+                        const size_t bucket = std::min<size_t>(std::bit_width(micros), bucketCount - 1);
+                        buckets[bucket]++;
+                        samples++;
+                    }
+                }
+
+                stream << stage << " (" << samples << " samples)\n";
+                for (size_t bucket = 0; bucket < bucketCount; ++bucket)
+                {
+                    if (buckets[bucket] == 0)
+                        continue;
+
+                    const uint64_t upper = bucket == 0 ? 1 : uint64_t{ 1 } << bucket;
+                    stream << "  < " << upper << "us: " << buckets[bucket] << "\n";
+                }
+            }
+        }
+
+    private:
+        struct Stage
+        {
+            const char* name;
+            int64_t begin;
+            int64_t end;
+        };
+
+        static std::array<Stage, 4> Stages(const TraceSpan& span)
+        {
+            return { {
+                { "queued-out", span.enqueued, span.written },
+                { "wire", span.written, span.read },
+                { "queued-in", span.read, span.dequeued },
+                { "handler", span.dequeued, span.handled }
+            } };
+        }
+
+        struct Slot
+        {
+            std::atomic<uint64_t> sequence{ 0 };
+            TraceSpan span;
+        };
+
+        std::atomic<uint64_t> m_head{ 0 };
+        std::array<Slot, Capacity> m_slots;
+    };
+
+    inline TraceRing& Tracer()
+    {
+        static TraceRing ring;
+        return ring;
+    }
+}
@@ -0,0 +1,217 @@
+#include "CommonIncludes.h"
+#include "ServerInterface.hpp"
+#include "Connection.hpp"
+#include "IoUring.hpp"
+#include "Message.hpp"
+#include "ThreadSafeQueue.hpp"
+
+#include <fstream>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+// Opens many loopback clients against one ServerInterface and reports memory
+// per connection, handshake rate and broadcast fan-out latency.
+//
+// Usage: stress [clients=10000] [broadcasts=10] [clientThreads=hardware]
+//
+// Every connection needs a descriptor on both ends, so raise the limit first
+// (ulimit -n) for anything above a few thousand clients.
+//
+// The stress_uring build runs the same harness on asio's io_uring backend.
+// On kernels where io_uring cannot be set up it says so and measures nothing.
+
+namespace
+{
+	enum class StressMessage : uint32_t
+	{
+		Broadcast
+	};
+
+	using Clock = std::chrono::steady_clock;
+
+	class StressServer : public sockets::ServerInterface<StressMessage>
+	{
+	public:
+		explicit StressServer(sockets::ConnectionSettings settings) : ServerInterface(0, settings) {}
+		~StressServer() override { Stop(); }
+
+		uint16_t Port() const { return m_asioAcceptor.local_endpoint().port(); }
+
+		bool OnClientConnect(std::shared_ptr<sockets::Connection<StressMessage>> client) override { return true; }
+		void OnClientDisconnect(std::shared_ptr<sockets::Connection<StressMessage>> client) override {}
+		void OnMessage(std::shared_ptr<sockets::Connection<StressMessage>> client, sockets::message<StressMessage>& msg) override {}
+		void OnClientValidated(std::shared_ptr<sockets::Connection<StressMessage>> client) override { validated++; }
+
+		std::atomic<size_t> validated{ 0 };
+	};
+
+	size_t ResidentBytes()
+	{
+#ifdef __linux__
+		std::ifstream statm("/proc/self/statm");
+		size_t pages = 0;
+		size_t resident = 0;
+		statm >> pages >> resident;
+		return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+		return 0;
+#endif
+	}
+
+	double Percentile(std::vector<double>& samples, double fraction)
+	{
+		if (samples.empty())
+			return 0.0;
+
+		const auto index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1));
+		std::ranges::nth_element(samples, samples.begin() + static_cast<std::ptrdiff_t>(index));
+		return samples[index];
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const size_t clientCount = argc > 1 ? std::stoul(argv[1]) : 10000;
+	const size_t broadcastCount = argc > 2 ? std::stoul(argv[2]) : 10;
+	const size_t threadCount = argc > 3 ? std::stoul(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+#ifdef SOCKETS_IO_URING
+	// asio cannot fall back to epoll inside an io_uring build; the epoll
+	// numbers come from the plain stress build, which bench runs first.
+	if (!sockets::IoUringAvailable())
+	{
+		std::cout << "backend:                  io_uring NOT MEASURED, this kernel refuses io_uring_setup" << std::endl;
+		return 0;
+	}
+#endif
+
+	// The library logs every connection; keep that out of the measurements.
+	auto* const consoleBuffer = std::cout.rdbuf(nullptr);
+
+	// Every server connection gets a registered header slot, up to what the
+	// kernel accepts.
+	sockets::ConnectionSettings settings;
+	settings.registeredHeaderSlots = clientCount;
+
+	StressServer server(settings);
+	if (!server.Start())
+		return 1;
+
+	asio::io_context clientContext;
+#ifdef SOCKETS_IO_URING
+	auto clientHeaders = std::make_shared<sockets::RegisteredHeaders<StressMessage>>(clientContext, clientCount);
+#endif
+	auto workGuard = asio::make_work_guard(clientContext);
+	std::vector<std::jthread> clientThreads;
+	for (size_t i = 0; i < threadCount; ++i)
+		clientThreads.emplace_back([&clientContext]() { clientContext.run(); });
+
+	std::mutex latencyMutex;
+	std::vector<double> latencies;
+	std::atomic<size_t> received{ 0 };
+	latencies.reserve(clientCount * broadcastCount);
+
+	sockets::ThreadSafeQueue<sockets::owned_message<StressMessage>> unused;
+	std::vector<std::unique_ptr<sockets::Connection<StressMessage>>> clients;
+	clients.reserve(clientCount);
+
+	const size_t baselineRss = ResidentBytes();
+	const auto handshakeStart = Clock::now();
+
+	// Each loopback destination address has its own ephemeral port range, so
+	// spread clients over 127.0.0.x to get past ~28k connections.
+	constexpr size_t clientsPerAddress = 20000;
+	constexpr size_t handshakeWindow = 512;
+	asio::ip::tcp::resolver resolver(clientContext);
+
+	for (size_t i = 0; i < clientCount; ++i)
+	{
+		while (i - server.validated >= handshakeWindow && Clock::now() - handshakeStart < std::chrono::seconds(120))
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+		const auto host = "127.0.0." + std::to_string(1 + i / clientsPerAddress);
+		auto endPoints = resolver.resolve(host, std::to_string(server.Port()));
+
+		auto client = std::make_unique<sockets::Connection<StressMessage>>(
+			sockets::Connection<StressMessage>::Owner::Client, clientContext, asio::ip::tcp::socket(clientContext), unused);
+#ifdef SOCKETS_IO_URING
+		client->SetRegisteredHeaders(clientHeaders);
+#endif
+
+		client->SetMessageHandler([&](sockets::owned_message<StressMessage>&& message)
+		{
+			int64_t sent = 0;
+			message.msg >> sent;
+			const auto latency = std::chrono::duration<double, std::micro>(Clock::now().time_since_epoch() - Clock::duration(sent));
+
+			std::lock_guard lock(latencyMutex);
+			latencies.push_back(latency.count());
+			received++;
+		});
+
+		client->ConnectToServer(endPoints);
+		clients.push_back(std::move(client));
+	}
+
+	while (server.validated < clientCount && Clock::now() - handshakeStart < std::chrono::seconds(120))
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	const auto handshakeTime = std::chrono::duration<double>(Clock::now() - handshakeStart);
+	const size_t connectedRss = ResidentBytes();
+	const size_t validated = server.validated;
+
+	std::vector<double> fanOut;
+	for (size_t round = 0; round < broadcastCount; ++round)
+	{
+		const size_t expected = received + validated;
+		const auto roundStart = Clock::now();
+
+		sockets::message<StressMessage> msg;
+		msg.header.id = StressMessage::Broadcast;
+		msg << static_cast<int64_t>(Clock::now().time_since_epoch().count());
+		server.MessageAllClients(msg);
+
+		while (received < expected && Clock::now() - roundStart < std::chrono::seconds(30))
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+		fanOut.push_back(std::chrono::duration<double, std::milli>(Clock::now() - roundStart).count());
+	}
+
+	// Sampled again so that buffers kept after the broadcasts, such as drained
+	// outbound lanes, show up in the per-connection figure.
+	const size_t broadcastRss = ResidentBytes();
+
+	std::cout.rdbuf(consoleBuffer);
+
+	std::cout << "backend:                  " << sockets::IoBackendName() << "\n";
+	std::cout << "clients requested:        " << clientCount << "\n";
+	std::cout << "clients validated:        " << validated << "\n";
+	std::cout << "sizeof(Connection):       " << sizeof(sockets::Connection<StressMessage>) << " bytes\n";
+	if (baselineRss > 0 && validated > 0)
+		std::cout << "RSS per connection:       " << (connectedRss - baselineRss) / validated << " bytes (client and server end)\n";
+	else
+		std::cout << "RSS per connection:       n/a\n";
+	if (baselineRss > 0 && validated > 0 && broadcastCount > 0)
+		std::cout << "  after broadcasts:       " << (broadcastRss - baselineRss) / validated << " bytes\n";
+	std::cout << "handshake rate:           " << static_cast<double>(validated) / handshakeTime.count() << " connections/s\n";
+
+	{
+		std::lock_guard lock(latencyMutex);
+		std::cout << "broadcast deliveries:     " << latencies.size() << " / " << validated * broadcastCount << "\n";
+		std::cout << "delivery latency p50:     " << Percentile(latencies, 0.50) << " us\n";
+		std::cout << "delivery latency p99:     " << Percentile(latencies, 0.99) << " us\n";
+		std::cout << "delivery latency max:     " << Percentile(latencies, 1.0) << " us\n";
+		std::cout << "broadcast fan-out p50:    " << Percentile(fanOut, 0.50) << " ms\n";
+		std::cout << "broadcast fan-out max:    " << Percentile(fanOut, 1.0) << " ms" << std::endl;
+	}
+
+	std::cout.rdbuf(nullptr);
+	workGuard.reset();
+	clientContext.stop();
+	clientThreads.clear();
+	clients.clear();
+
+	return 0;
+}
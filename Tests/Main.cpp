@@ -14,6 +14,644 @@ TEST(CommonTest, Encrypt)
 	EXPECT_EQ(random, decrypted);
 }
 
+namespace
+{
+	enum class TestMessage : uint32_t
+	{
+		Ping,
+		Bulk
+	};
+
+	class TestServer : public sockets::ServerInterface<TestMessage>
+	{
+	public:
+		explicit TestServer(sockets::ConnectionSettings settings = {}) : ServerInterface(0, settings) {}
+		~TestServer() override { Stop(); }
+
+		uint16_t Port() const { return m_asioAcceptor.local_endpoint().port(); }
+
+		bool OnClientConnect(std::shared_ptr<sockets::Connection<TestMessage>> client) override { return true; }
+		void OnClientDisconnect(std::shared_ptr<sockets::Connection<TestMessage>> client) override {}
+		void OnClientValidated(std::shared_ptr<sockets::Connection<TestMessage>> client) override {}
+
+		void OnMessage(std::shared_ptr<sockets::Connection<TestMessage>> client, sockets::message<TestMessage>& msg) override
+		{
+			received.push_back(msg);
+		}
+
+		bool WaitFor(size_t count, std::chrono::seconds timeout = std::chrono::seconds(10))
+		{
+			const auto deadline = std::chrono::steady_clock::now() + timeout;
+			while (received.size() < count && std::chrono::steady_clock::now() < deadline)
+			{
+				Update();
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			return received.size() >= count;
+		}
+
+		std::vector<sockets::message<TestMessage>> received;
+	};
+
+	class ReapingServer : public TestServer
+	{
+	public:
+		using TestServer::TestServer;
+
+		void OnClientDisconnect(std::shared_ptr<sockets::Connection<TestMessage>> client) override { disconnects++; }
+
+		std::atomic<int> disconnects{ 0 };
+	};
+
+	bool WaitForValidation(const sockets::ClientInterface<TestMessage>& client)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (!client.IsConnected() && std::chrono::steady_clock::now() < deadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return client.IsConnected();
+	}
+}
+
+TEST(MessageTest, HeaderSizeTracksBody)
+{
+	sockets::message<TestMessage> msg;
+	msg << uint64_t{ 42 } << uint32_t{ 7 };
+	EXPECT_EQ(msg.header.size, sizeof(uint64_t) + sizeof(uint32_t));
+
+	uint32_t small = 0;
+	msg >> small;
+	EXPECT_EQ(small, 7u);
+	EXPECT_EQ(msg.header.size, sizeof(uint64_t));
+}
+
+TEST(PriorityTest, HighLaneOvertakesFragmentedBulk)
+{
+	TestServer server;
+	ASSERT_TRUE(server.Start());
+
+	sockets::ClientInterface<TestMessage> client;
+	client.SetPriority(TestMessage::Ping, sockets::Priority::High);
+	ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+	ASSERT_TRUE(WaitForValidation(client));
+
+	sockets::message<TestMessage> bulk;
+	bulk.header.id = TestMessage::Bulk;
+	bulk.body.assign(8 * 1024 * 1024, 0xAB);
+	bulk.header.size = static_cast<uint32_t>(bulk.body.size());
+
+	sockets::message<TestMessage> ping;
+	ping.header.id = TestMessage::Ping;
+
+	client.Send(bulk, sockets::Priority::Low);
+	client.Send(ping);
+
+	ASSERT_TRUE(server.WaitFor(2));
+	EXPECT_EQ(server.received[0].header.id, TestMessage::Ping);
+	EXPECT_EQ(server.received[1].header.id, TestMessage::Bulk);
+	EXPECT_EQ(server.received[1].body, bulk.body);
+}
+
+TEST(StreamTest, ChunksReachHandlerWithoutReassembly)
+{
+	std::atomic<size_t> bytes{ 0 };
+	std::atomic<size_t> largestChunk{ 0 };
+	std::atomic_bool finished{ false };
+
+	TestServer server;
+	server.SetStreamHandler(TestMessage::Bulk,
+		[&](auto remote, const sockets::message_header<TestMessage>& header, std::span<const uint8_t> chunk, bool last)
+		{
+			bytes += chunk.size();
+			largestChunk = std::max<size_t>(largestChunk, chunk.size());
+			finished = last;
+		});
+	ASSERT_TRUE(server.Start());
+
+	sockets::ClientInterface<TestMessage> client;
+	ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+	ASSERT_TRUE(WaitForValidation(client));
+
+	constexpr size_t chunkSize = 32 * 1024;
+	constexpr int chunkCount = 16;
+	client.SendStream(TestMessage::Bulk, [produced = 0](std::vector<uint8_t>& chunk) mutable
+	{
+		chunk.assign(chunkSize, static_cast<uint8_t>(produced));
+		return ++produced < chunkCount;
+	});
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!finished && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	ASSERT_TRUE(finished);
+	EXPECT_EQ(bytes, chunkSize * chunkCount);
+	EXPECT_EQ(largestChunk, chunkSize);
+	EXPECT_TRUE(server.received.empty());
+}
+
+TEST(StreamTest, ProducerChunksAreSplitAtMaxChunkSize)
+{
+	std::atomic<size_t> bytes{ 0 };
+	std::atomic<size_t> largestChunk{ 0 };
+	std::atomic_bool finished{ false };
+
+	TestServer server;
+	server.SetStreamHandler(TestMessage::Bulk,
+		[&](auto remote, const sockets::message_header<TestMessage>& header, std::span<const uint8_t> chunk, bool last)
+		{
+			bytes += chunk.size();
+			largestChunk = std::max<size_t>(largestChunk, chunk.size());
+			finished = last;
+		});
+	ASSERT_TRUE(server.Start());
+
+	sockets::ConnectionSettings clientSettings;
+	clientSettings.maxChunkSize = 16 * 1024;
+	sockets::ClientInterface<TestMessage> client(clientSettings);
+	ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+	ASSERT_TRUE(WaitForValidation(client));
+
+	constexpr size_t chunkSize = 100 * 1024;
+	constexpr int chunkCount = 3;
+	client.SendStream(TestMessage::Bulk, [produced = 0](std::vector<uint8_t>& chunk) mutable
+	{
+		chunk.assign(chunkSize, static_cast<uint8_t>(produced));
+		return ++produced < chunkCount;
+	});
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!finished && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	ASSERT_TRUE(finished);
+	EXPECT_EQ(bytes, chunkSize * chunkCount);
+	EXPECT_EQ(largestChunk, clientSettings.maxChunkSize);
+}
+
+TEST(StreamTest, OversizedFrameClosesConnection)
+{
+	sockets::ConnectionSettings serverSettings;
+	serverSettings.maxFrameSize = 1024;
+	TestServer server(serverSettings);
+	ASSERT_TRUE(server.Start());
+
+	sockets::ConnectionSettings clientSettings;
+	clientSettings.maxChunkSize = 0;
+	sockets::ClientInterface<TestMessage> client(clientSettings);
+	ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+	ASSERT_TRUE(WaitForValidation(client));
+
+	sockets::message<TestMessage> bulk;
+	bulk.header.id = TestMessage::Bulk;
+	bulk.body.resize(4096);
+	client.Send(bulk);
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (client.IsConnected() && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	EXPECT_FALSE(client.IsConnected());
+	server.Update();
+	EXPECT_TRUE(server.received.empty());
+}
+
+TEST(ServerTest, DestroyedWithUndeliveredMessages)
+{
+	class IdleServer : public TestServer
+	{
+	public:
+		using TestServer::TestServer;
+
+		bool HasPending() const { return !m_messagesIn.empty(); }
+	};
+
+	sockets::ClientInterface<TestMessage> client;
+	{
+		IdleServer server;
+		ASSERT_TRUE(server.Start());
+		ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+		ASSERT_TRUE(WaitForValidation(client));
+
+		sockets::message<TestMessage> ping;
+		ping.header.id = TestMessage::Ping;
+		client.Send(ping);
+
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (!server.HasPending() && std::chrono::steady_clock::now() < deadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		ASSERT_TRUE(server.HasPending());
+	}
+
+	// The queued message owned the server end of the connection; it has to be
+	// gone with the server rather than outlive its io_context.
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (client.IsConnected() && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_FALSE(client.IsConnected());
+}
+
+TEST(ConnectionTest, OutboundLanesAreReturnedOnceDrained)
+{
+	class ProbeConnection : public sockets::Connection<TestMessage>
+	{
+	public:
+		using Connection::Connection;
+
+		bool HasLanes() const { return m_messagesOut != nullptr; }
+	};
+
+	TestServer server;
+	ASSERT_TRUE(server.Start());
+
+	asio::io_context context;
+	sockets::ThreadSafeQueue<sockets::owned_message<TestMessage>> incoming;
+	auto client = std::make_shared<ProbeConnection>(ProbeConnection::Owner::Client, context, asio::ip::tcp::socket(context), incoming);
+
+	asio::ip::tcp::resolver resolver(context);
+	client->ConnectToServer(resolver.resolve("127.0.0.1", std::to_string(server.Port())));
+	std::jthread thread([&context]() { context.run(); });
+
+	// Enough messages to queue up behind the handshake and compact the lane.
+	constexpr uint32_t count = 100;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		sockets::message<TestMessage> ping;
+		ping.header.id = TestMessage::Ping;
+		ping << i;
+		client->Send(ping);
+	}
+	ASSERT_TRUE(server.WaitFor(count));
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t sequence = 0;
+		server.received[i] >> sequence;
+		EXPECT_EQ(sequence, i);
+	}
+
+	std::atomic_bool hasLanes{ true };
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (hasLanes && std::chrono::steady_clock::now() < deadline)
+	{
+		asio::post(context, [&]() { hasLanes = client->HasLanes(); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	context.stop();
+	thread.join();
+
+	EXPECT_FALSE(hasLanes);
+}
+
+TEST(DispatchTest, InlineRunsOnMessageOnIoThread)
+{
+	class InlineServer : public TestServer
+	{
+	public:
+		using TestServer::TestServer;
+
+		void OnMessage(std::shared_ptr<sockets::Connection<TestMessage>> client, sockets::message<TestMessage>& msg) override
+		{
+			handlerThread = std::this_thread::get_id();
+			MessageClient(client, msg);
+		}
+
+		std::atomic<std::thread::id> handlerThread{};
+	};
+
+	class EchoClient : public sockets::ClientInterface<TestMessage>
+	{
+	public:
+		using ClientInterface::ClientInterface;
+		~EchoClient() override { Disconnect(); }
+
+		void OnMessage(sockets::message<TestMessage>& msg) override { echoes++; }
+
+		std::atomic<int> echoes{ 0 };
+	};
+
+	sockets::ConnectionSettings settings;
+	settings.dispatch = sockets::ConnectionSettings::Dispatch::Inline;
+
+	InlineServer server(settings);
+	ASSERT_TRUE(server.Start());
+
+	EchoClient client(settings);
+	ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+	ASSERT_TRUE(WaitForValidation(client));
+
+	sockets::message<TestMessage> ping;
+	ping.header.id = TestMessage::Ping;
+	client.Send(ping);
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (client.echoes == 0 && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	EXPECT_EQ(client.echoes, 1);
+	EXPECT_NE(server.handlerThread.load(), std::thread::id{});
+	EXPECT_NE(server.handlerThread.load(), std::this_thread::get_id());
+	EXPECT_TRUE(client.Incoming().empty());
+}
+
+TEST(DispatchTest, InlineUpdateWaitsForStop)
+{
+	sockets::ConnectionSettings settings;
+	settings.dispatch = sockets::ConnectionSettings::Dispatch::Inline;
+
+	TestServer server(settings);
+	ASSERT_TRUE(server.Start());
+
+	std::atomic_bool returned{ false };
+	std::jthread updater([&]()
+	{
+		server.Update(std::numeric_limits<size_t>::max(), true);
+		returned = true;
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_FALSE(returned);
+
+	server.Stop();
+	updater.join();
+	EXPECT_TRUE(returned);
+}
+
+TEST(TraceTest, RingKeepsLatestSpansAndExportsStages)
+{
+	auto ringStorage = std::make_unique<sockets::TraceRing>();
+	auto& ring = *ringStorage;
+	for (uint32_t i = 0; i < sockets::TraceRing::Capacity + 10; ++i)
+		ring.Record({ i, 1, 1000, 2000, 3000, 4000, 5000 });
+
+	const auto spans = ring.Snapshot();
+	ASSERT_EQ(spans.size(), sockets::TraceRing::Capacity);
+	EXPECT_EQ(spans.front().id, 10u);
+	EXPECT_EQ(spans.back().id, sockets::TraceRing::Capacity + 9);
+
+	ring.Clear();
+	ring.Record({ 7, 3, 1000, 2000, 3000, 4000, 5000 });
+
+	std::ostringstream json;
+	ring.WriteChromeTrace(json);
+	EXPECT_NE(json.str().find("\"name\":\"wire\""), std::string::npos);
+	EXPECT_NE(json.str().find("\"tid\":3"), std::string::npos);
+
+	std::ostringstream histograms;
+	ring.WriteHistograms(histograms);
+	EXPECT_NE(histograms.str().find("handler (1 samples)"), std::string::npos);
+}
+
+#ifdef SOCKETS_TRACING
+TEST(TraceTest, SampledMessagesRecordEveryStage)
+{
+	sockets::Tracer().Clear();
+
+	sockets::ConnectionSettings settings;
+	settings.traceSampleEvery = 1;
+
+	TestServer server(settings);
+	ASSERT_TRUE(server.Start());
+
+	sockets::ClientInterface<TestMessage> client(settings);
+	ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+	ASSERT_TRUE(WaitForValidation(client));
+
+	sockets::message<TestMessage> ping;
+	ping.header.id = TestMessage::Ping;
+	client.Send(ping);
+	ASSERT_TRUE(server.WaitFor(1));
+
+	const auto spans = sockets::Tracer().Snapshot();
+	ASSERT_EQ(spans.size(), 1u);
+	EXPECT_LE(spans[0].enqueued, spans[0].written);
+	EXPECT_LE(spans[0].read, spans[0].dequeued);
+	EXPECT_LE(spans[0].dequeued, spans[0].handled);
+}
+
+TEST(TraceTest, ServerOnlyStampsFramesForClientsThatRecordSpans)
+{
+	class CountingServer : public TestServer
+	{
+	public:
+		using TestServer::TestServer;
+
+		void OnClientValidated(std::shared_ptr<sockets::Connection<TestMessage>> client) override { validated++; }
+
+		std::atomic<int> validated{ 0 };
+	};
+
+	class InlineClient : public sockets::ClientInterface<TestMessage>
+	{
+	public:
+		using ClientInterface::ClientInterface;
+		~InlineClient() override { Disconnect(); }
+
+		void OnMessage(sockets::message<TestMessage>& msg) override { received++; }
+
+		std::atomic<int> received{ 0 };
+	};
+
+	sockets::Tracer().Clear();
+
+	sockets::ConnectionSettings settings;
+	settings.traceSampleEvery = 1;
+
+	CountingServer server(settings);
+	ASSERT_TRUE(server.Start());
+
+	sockets::ClientInterface<TestMessage> queued(settings);
+	ASSERT_TRUE(queued.Connect("127.0.0.1", server.Port()));
+
+	auto inlineSettings = settings;
+	inlineSettings.dispatch = sockets::ConnectionSettings::Dispatch::Inline;
+	InlineClient inlined(inlineSettings);
+	ASSERT_TRUE(inlined.Connect("127.0.0.1", server.Port()));
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (server.validated < 2 && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	ASSERT_EQ(server.validated, 2);
+
+	sockets::message<TestMessage> ping;
+	ping.header.id = TestMessage::Ping;
+	server.MessageAllClients(ping);
+
+	deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ((queued.Incoming().empty() || inlined.received == 0) && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	ASSERT_FALSE(queued.Incoming().empty());
+	EXPECT_FALSE(queued.Incoming().pop_front().msg.header.flags & sockets::FrameTraced);
+	EXPECT_EQ(inlined.received, 1);
+	EXPECT_EQ(sockets::Tracer().Snapshot().size(), 1u);
+}
+#endif
+
+TEST(TimerWheelTest, FiresEntriesOnTheirTickAcrossLevels)
+{
+	sockets::TimerWheel<uint64_t> wheel;
+	const std::vector<uint64_t> deadlines{ 1, 5, 63, 64, 65, 4095, 4096, 4097, 300000 };
+	for (const auto deadline : deadlines)
+		wheel.Schedule(deadline, deadline);
+
+	std::vector<std::pair<uint64_t, uint64_t>> fired;
+	wheel.Advance(400000, [&](uint64_t deadline) { fired.emplace_back(wheel.Now(), deadline); });
+
+	ASSERT_EQ(fired.size(), deadlines.size());
+	for (const auto& [tick, deadline] : fired)
+		EXPECT_EQ(tick, deadline);
+	EXPECT_EQ(wheel.Size(), 0u);
+}
+
+TEST(TimerTest, IdleTimeoutReapsSilentClient)
+{
+	sockets::ConnectionSettings serverSettings;
+	serverSettings.idleTimeout = std::chrono::milliseconds(100);
+	ReapingServer server(serverSettings);
+	ASSERT_TRUE(server.Start());
+
+	// Heartbeats keep this one alive well past the server's idle timeout.
+	sockets::ConnectionSettings beatingSettings;
+	beatingSettings.heartbeatInterval = std::chrono::milliseconds(20);
+	sockets::ClientInterface<TestMessage> beating(beatingSettings);
+	ASSERT_TRUE(beating.Connect("127.0.0.1", server.Port()));
+	ASSERT_TRUE(WaitForValidation(beating));
+
+	sockets::ClientInterface<TestMessage> silent;
+	ASSERT_TRUE(silent.Connect("127.0.0.1", server.Port()));
+	ASSERT_TRUE(WaitForValidation(silent));
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (silent.IsConnected() && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	EXPECT_FALSE(silent.IsConnected());
+	EXPECT_TRUE(beating.IsConnected());
+	EXPECT_EQ(server.disconnects, 1);
+	EXPECT_TRUE(server.received.empty());
+}
+
+TEST(TimerTest, ClosedConnectionIsReportedRightAway)
+{
+	// Only the handshake deadline is set, and it no longer applies once the
+	// client validated; the read error alone has to get the client reaped.
+	sockets::ConnectionSettings serverSettings;
+	serverSettings.handshakeTimeout = std::chrono::seconds(30);
+	ReapingServer server(serverSettings);
+	ASSERT_TRUE(server.Start());
+
+	{
+		sockets::ClientInterface<TestMessage> client;
+		ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+		ASSERT_TRUE(WaitForValidation(client));
+
+		// Let the wheel look at the connection while it is still healthy.
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (server.disconnects == 0 && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_EQ(server.disconnects, 1);
+}
+
+TEST(TimerTest, HeartbeatWithBodyClosesConnection)
+{
+	TestServer server;
+	ASSERT_TRUE(server.Start());
+
+	asio::io_context context;
+	asio::ip::tcp::socket socket(context);
+	socket.connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.Port()));
+
+	uint64_t challenge = 0;
+	uint8_t capabilities = 0;
+	asio::read(socket, std::array<asio::mutable_buffer, 2>{ asio::buffer(&challenge, sizeof(challenge)), asio::buffer(&capabilities, sizeof(capabilities)) });
+
+	const uint64_t answer = sockets::Connection<TestMessage>::Encrypt(challenge);
+	const uint8_t noCapabilities = 0;
+	sockets::message_header<TestMessage> heartbeat{};
+	heartbeat.size = 4;
+	heartbeat.flags = sockets::FrameHeartbeat;
+	const uint32_t body = 0;
+	asio::write(socket, std::array<asio::const_buffer, 4>{ asio::buffer(&answer, sizeof(answer)), asio::buffer(&noCapabilities, sizeof(noCapabilities)),
+		asio::buffer(&heartbeat, sizeof(heartbeat)), asio::buffer(&body, sizeof(body)) });
+
+	// The server has to hang up rather than read the body as the next header.
+	bool closed = false;
+	std::array<uint8_t, 64> sink{};
+	asio::async_read(socket, asio::buffer(sink), [&closed](auto errorCode, std::size_t length)
+	{
+		closed = static_cast<bool>(errorCode);
+	});
+	context.run_for(std::chrono::seconds(10));
+
+	EXPECT_TRUE(closed);
+	server.Update();
+	EXPECT_TRUE(server.received.empty());
+}
+
+TEST(HandshakeTest, MessagesSentBeforeValidationArrive)
+{
+	TestServer server;
+	ASSERT_TRUE(server.Start());
+
+	sockets::ClientInterface<TestMessage> client;
+	ASSERT_TRUE(client.Connect("127.0.0.1", server.Port()));
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		sockets::message<TestMessage> ping;
+		ping.header.id = TestMessage::Ping;
+		ping << i;
+		client.Send(ping);
+	}
+
+	ASSERT_TRUE(server.WaitFor(3));
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		uint32_t sequence = 0;
+		server.received[i] >> sequence;
+		EXPECT_EQ(sequence, i);
+	}
+}
+
+
+TEST(HandshakeTest, EarlyMessagesAreBoundedUntilTheServerAnswers)
+{
+	asio::io_context context;
+	asio::ip::tcp::acceptor acceptor(context, asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+
+	sockets::ConnectionSettings settings;
+	settings.maxEarlyMessages = 4;
+	sockets::ClientInterface<TestMessage> client(settings);
+	ASSERT_TRUE(client.Connect("127.0.0.1", acceptor.local_endpoint().port()));
+
+	asio::ip::tcp::socket socket(context);
+	acceptor.accept(socket);
+
+	for (uint32_t i = 0; i < 10; ++i)
+	{
+		sockets::message<TestMessage> ping;
+		ping.header.id = TestMessage::Ping;
+		ping << i;
+		client.Send(ping);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	// Answer only now; the reply carries exactly the first maxEarlyMessages frames.
+	const uint64_t challenge = 42;
+	const uint8_t capabilities = 0;
+	asio::write(socket, std::array<asio::const_buffer, 2>{ asio::buffer(&challenge, sizeof(challenge)), asio::buffer(&capabilities, sizeof(capabilities)) });
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	const size_t frame = sizeof(sockets::message_header<TestMessage>) + sizeof(uint32_t);
+	EXPECT_EQ(socket.available(), sizeof(uint64_t) + sizeof(uint8_t) + settings.maxEarlyMessages * frame);
+}
 
 int RunAllTests()
 {